@@ -13,7 +13,7 @@ run ./factor_p-1 n B1 B2
 int main(int argc, char* argv[]){
     if (argc == 4){
         mpz_t n, B1, B2;
-        mpz_inits(n, B1, B2);
+        mpz_inits(n, B1, B2, NULL);
 
         mpz_set_str(n, argv[1], 10);
         mpz_set_str(B1, argv[2], 10);
@@ -1,20 +1,202 @@
+#include "primesieve.h"
+
 /*
 find a prime divisor p of a composite number n by trial division by prime numbers 
 from p_min to p_max
+the primes are enumerated by the segmented sieve, mpz_nextprime is only used when p_max
+does not fit in an unsigned long
 */
 int successive_division(mpz_t p, mpz_t n, mpz_t p_min, mpz_t p_max){
-
-    mpz_nextprime(p, p_min);
     int r = -1;
 
-    while (mpz_cmp(p, p_max) <= 0){
-        if (mpz_divisible_p(n, p)) {
+    if (!mpz_fits_ulong_p(p_max)){
+        mpz_nextprime(p, p_min);
+        while (mpz_cmp(p, p_max) <= 0){
+            if (mpz_divisible_p(n, p)) {
+                r = 0;
+                break;
+            }
+            mpz_nextprime(p, p);
+        }
+        return r;
+    }
+
+    prime_iterator it;
+    prime_iterator_init(&it, mpz_get_ui(p_min) + 1, mpz_get_ui(p_max));
+
+    unsigned long q;
+    while ((q = prime_iterator_next(&it)) != 0){
+        if (mpz_divisible_ui_p(n, q)) {
+            mpz_set_ui(p, q);
             r = 0;
             break;
         }
-        mpz_nextprime(p, p);
     }
 
+    prime_iterator_clear(&it);
+    return r;
+}
+
+/*
+trial division modes used by factorization_division
+TRIAL_DIVISION_AUTO picks the remainder tree when n has at least TRIAL_DIVISION_TREE_BITS bits
+*/
+#define TRIAL_DIVISION_AUTO 0
+#define TRIAL_DIVISION_SIEVE 1
+#define TRIAL_DIVISION_TREE 2
+#define TRIAL_DIVISION_TREE_BITS 1024
+
+int trial_division_mode = TRIAL_DIVISION_AUTO;
+
+/*
+products of consecutive primes, each block holds PRIME_BLOCK_SIZE primes
+the blocks only depend on the bound, they are built once and shared by every number
+a cache is never freed when a larger bound replaces it since another thread may still read it
+*/
+#define PRIME_BLOCK_SIZE 64
+
+typedef struct prime_product_cache {
+    unsigned long bound;        // every prime <= bound is in a block
+    size_t nblocks;
+    mpz_t *product;             // product of the primes of each block
+    unsigned long *first;       // smallest prime of each block
+    unsigned long *last;        // largest prime of each block
+} prime_product_cache;
+
+prime_product_cache *prime_products = NULL;
+pthread_mutex_t prime_products_lock = PTHREAD_MUTEX_INITIALIZER;
+
+prime_product_cache *prime_product_blocks(unsigned long bound){
+    pthread_mutex_lock(&prime_products_lock);
+    if ((prime_products != NULL) && (prime_products->bound >= bound)){
+        prime_product_cache *c = prime_products;
+        pthread_mutex_unlock(&prime_products_lock);
+        return c;
+    }
+
+    prime_product_cache *c = (prime_product_cache*) malloc(sizeof(prime_product_cache));
+    c->bound = bound;
+    c->nblocks = 0;
+    size_t alloc = 16;
+    c->product = (mpz_t*) malloc(alloc * sizeof(mpz_t));
+    c->first = (unsigned long*) malloc(alloc * sizeof(unsigned long));
+    c->last = (unsigned long*) malloc(alloc * sizeof(unsigned long));
+
+    prime_iterator it;
+    prime_iterator_init(&it, 2, bound);
+    unsigned long q = prime_iterator_next(&it);
+    while (q != 0){
+        if (c->nblocks == alloc){
+            alloc *= 2;
+            c->product = (mpz_t*) realloc(c->product, alloc * sizeof(mpz_t));
+            c->first = (unsigned long*) realloc(c->first, alloc * sizeof(unsigned long));
+            c->last = (unsigned long*) realloc(c->last, alloc * sizeof(unsigned long));
+        }
+        mpz_init_set_ui(c->product[c->nblocks], 1);
+        c->first[c->nblocks] = q;
+        for (int i = 0; (i < PRIME_BLOCK_SIZE) && (q != 0); i++){
+            mpz_mul_ui(c->product[c->nblocks], c->product[c->nblocks], q);
+            c->last[c->nblocks] = q;
+            q = prime_iterator_next(&it);
+        }
+        c->nblocks++;
+    }
+    prime_iterator_clear(&it);
+
+    prime_products = c;
+    pthread_mutex_unlock(&prime_products_lock);
+    return c;
+}
+
+/*
+find a prime divisor p of n with p_min < p <= p_max, same result as successive_division
+n is reduced modulo groups of prime blocks through a product/remainder tree, a block is only
+divided prime by prime when gcd(n mod block, block) is nontrivial
+a group gathers consecutive blocks until their product is about the size of n
+*/
+int successive_division_tree(mpz_t p, mpz_t n, mpz_t p_min, mpz_t p_max){
+    if (!mpz_fits_ulong_p(p_max)) return successive_division(p, n, p_min, p_max);
+
+    unsigned long lo = mpz_get_ui(p_min);
+    unsigned long hi = mpz_get_ui(p_max);
+    prime_product_cache *c = prime_product_blocks(hi);
+    size_t nbits = mpz_sizeinbase(n, 2);
+
+    // product tree of a group, level l starts at tree[offset[l]] and has width[l] nodes
+    // level 0 holds the blocks and level depth the root
+    size_t cap = 0, offset[64], width[64];
+    mpz_t *tree = NULL;
+    mpz_t g;
+    mpz_init(g);
+
+    int r = -1;
+    size_t b = 0;
+    while ((b < c->nblocks) && (c->last[b] <= lo)) b++;
+
+    while ((r != 0) && (b < c->nblocks) && (c->first[b] <= hi)){
+        // gather the blocks of the group
+        size_t start = b, bits = 0;
+        while ((b < c->nblocks) && (c->first[b] <= hi) && (bits < nbits)){
+            bits += mpz_sizeinbase(c->product[b], 2);
+            b++;
+        }
+
+        size_t depth = 0;
+        offset[0] = 0;
+        width[0] = b - start;
+        while (width[depth] > 1){
+            offset[depth + 1] = offset[depth] + width[depth];
+            width[depth + 1] = (width[depth] + 1) / 2;
+            depth++;
+        }
+        size_t total = offset[depth] + width[depth];
+        if (total > cap){
+            tree = (mpz_t*) realloc(tree, total * sizeof(mpz_t));
+            for (size_t i = cap; i < total; i++) mpz_init(tree[i]);
+            cap = total;
+        }
+
+        for (size_t i = 0; i < width[0]; i++) mpz_set(tree[i], c->product[start + i]);
+        for (size_t l = 1; l <= depth; l++){
+            for (size_t i = 0; i < width[l]; i++){
+                if (2 * i + 1 < width[l - 1]) mpz_mul(tree[offset[l] + i], tree[offset[l - 1] + 2 * i], tree[offset[l - 1] + 2 * i + 1]);
+                else mpz_set(tree[offset[l] + i], tree[offset[l - 1] + 2 * i]);
+            }
+        }
+
+        // remainder tree top down: each node is replaced by n mod node
+        mpz_mod(tree[offset[depth]], n, tree[offset[depth]]);
+        for (size_t l = depth; l > 0; l--){
+            for (size_t i = 0; i < width[l]; i++){
+                mpz_mod(tree[offset[l - 1] + 2 * i], tree[offset[l] + i], tree[offset[l - 1] + 2 * i]);
+                if (2 * i + 1 < width[l - 1]) mpz_mod(tree[offset[l - 1] + 2 * i + 1], tree[offset[l] + i], tree[offset[l - 1] + 2 * i + 1]);
+            }
+        }
+
+        // the leaves hold n mod block, only divide by the primes of a block sharing a factor with n
+        for (size_t i = 0; (i < width[0]) && (r != 0); i++){
+            mpz_gcd(g, tree[i], c->product[start + i]);
+            if (mpz_cmp_ui(g, 1) == 0) continue;
+
+            unsigned long from = (c->first[start + i] > lo) ? c->first[start + i] : lo + 1;
+            unsigned long to = (c->last[start + i] < hi) ? c->last[start + i] : hi;
+            prime_iterator it;
+            prime_iterator_init(&it, from, to);
+            unsigned long q;
+            while ((q = prime_iterator_next(&it)) != 0){
+                if (mpz_divisible_ui_p(g, q)) {
+                    mpz_set_ui(p, q);
+                    r = 0;
+                    break;
+                }
+            }
+            prime_iterator_clear(&it);
+        }
+    }
+
+    for (size_t i = 0; i < cap; i++) mpz_clear(tree[i]);
+    free(tree);
+    mpz_clear(g);
     return r;
 }
 
@@ -264,7 +446,7 @@ int pollard_rho_brent_opt(mpz_t d, mpz_t n, mpz_t c, long long int B, int m){
 
 
 int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
-    mpz_t a, p, q, t;
+    mpz_t a, t;
     mpz_init_set_ui(a, 1);
 
     gmp_randstate_t state;
@@ -285,19 +467,29 @@ int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
         return 0;
     }
 
-    mpz_inits(p, q, NULL);
-    mpz_set_ui(p, 2);
+    // the primes of both stages are drawn from the same sieve
+    // the sieve goes a little beyond the bounds since stage 2 looks at the gap to the next prime
+    unsigned long b1 = mpz_fits_ulong_p(B1) ? mpz_get_ui(B1) : ULONG_MAX - 1000;
+    unsigned long b2 = mpz_fits_ulong_p(B2) ? mpz_get_ui(B2) : ULONG_MAX - 1000;
+    if (b1 > ULONG_MAX - 1000) b1 = ULONG_MAX - 1000;
+    if (b2 > ULONG_MAX - 1000) b2 = ULONG_MAX - 1000;
+    unsigned long stop = ((b2 > b1) ? b2 : b1) + 1000;
+
+    prime_iterator it;
+    prime_iterator_init(&it, 2, stop);
+    unsigned long p = prime_iterator_next(&it);
     mpz_set(d, n);
 
     int r = -1;
     
     while(mpz_cmp(d, n) == 0){
-        while (mpz_cmp(p, B1) <= 0){
+        while (p <= b1){
 
-            mpz_set_ui(q, 1);
-            while(mpz_cmp(q, B1) <= 0){
-                mpz_powm(a, a, p, n); // a <- a^p mod n
-                mpz_mul(q, q, p); // q <- q*p
+            unsigned long q = 1;
+            while(q <= b1){
+                mpz_powm_ui(a, a, p, n); // a <- a^p mod n
+                if (q > b1 / p) break;
+                q = q*p;
             }
 
             mpz_sub_ui(t, a, 1);
@@ -310,7 +502,7 @@ int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
             }
 
             // go to the next prime
-            mpz_nextprime(p, p);
+            p = prime_iterator_next(&it);
         }
 
         // all prime powers are tested, no divisor found
@@ -326,20 +518,20 @@ int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
                 r = 0;
                 break;
             }
-            mpz_set_ui(p, 2);
-            mpz_set_ui(q, 1);
+            prime_iterator_clear(&it);
+            prime_iterator_init(&it, 2, stop);
+            p = prime_iterator_next(&it);
         }
     }
 
     gmp_randclear(state);
 
     // stage 2 of the algorithm, only started when B2 > B1 and no factor found after stage 1
-    if ((mpz_cmp(B2, B1) > 0) && (r != 0)){
+    if ((b2 > b1) && (r != 0)){
         // precompute the prime gap table
         // gap between primes less than 10^15 is less than 1000
 
-        mpz_t p_next, g, gap[1000];
-        mpz_inits(p_next, g, NULL);
+        mpz_t gap[1000];
 
         // at the end of stage 1, a = base^(product of prime powers <= B1) mod n
         // compute a^(2k) for 0 < 2k < 1000 and store in gap[2k-1] 
@@ -349,14 +541,13 @@ int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
         }
 
         // p is the first prime > B1, then first we must compute a^p mod n
-        mpz_powm(a, a, p, n);
+        mpz_powm_ui(a, a, p, n);
         
 
         // compute a = a^p * a^(next prime to p - p) for all primes p <= B2 
-        while(mpz_cmp(p, B2) <= 0){
-            mpz_nextprime(p_next, p);
-            mpz_sub(g, p_next, p); // compute gap = next prime p_next - current prime p
-            int i = mpz_get_ui(g);
+        while(p <= b2){
+            unsigned long p_next = prime_iterator_next(&it);
+            int i = p_next - p; // compute gap = next prime p_next - current prime p
             mpz_mul(a, a, gap[i-1]); // compute a^p * a^gap
             mpz_mod(a, a, n);
             
@@ -369,14 +560,14 @@ int p_minus_1(mpz_t d, mpz_t n, mpz_t B1, mpz_t B2){
             }
 
             // go to the next prime
-            mpz_set(p, p_next);
+            p = p_next;
         }
 
         // clear data;
-        mpz_clears(p_next, g, NULL);
         for(int i = 1; i < 1000; i = i+2) mpz_clear(gap[i]);
     }
     
-    mpz_clears(a, p, q, t, NULL);
+    prime_iterator_clear(&it);
+    mpz_clears(a, t, NULL);
     return r;
 }
\ No newline at end of file
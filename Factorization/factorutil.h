@@ -73,8 +73,11 @@ int factorization_division(factor *f, mpz_t n, mpz_t p_max){
     mpz_set_ui(p_min, 1);
 
     while (mpz_cmp_ui(N, 1) > 0){
-        // trial division by primes from p_min to p_max
-        r = successive_division(p, N, p_min, p_max);
+        // trial division by primes from p_min to p_max, large N go through the remainder tree
+        if ((trial_division_mode == TRIAL_DIVISION_TREE) ||
+            ((trial_division_mode == TRIAL_DIVISION_AUTO) && (mpz_sizeinbase(N, 2) >= TRIAL_DIVISION_TREE_BITS)))
+            r = successive_division_tree(p, N, p_min, p_max);
+        else r = successive_division(p, N, p_min, p_max);
         if (r != 0) break; // fail
 
         // store the found prime factor p
@@ -0,0 +1,258 @@
+#ifndef PRIMESIEVE_H
+#define PRIMESIEVE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+
+/*
+segmented sieve of Eratosthenes used by every method to enumerate primes in increasing order
+
+the sieve only stores the numbers coprime to 30 (wheel 2*3*5): one byte covers 30 consecutive
+integers, bit k of the byte stands for 30*i + wheel30[k]
+a segment is SIEVE_SEGMENT_BYTES bytes so that it stays in the L1 cache while it is sieved,
+when the range still to be enumerated is large, several segments are sieved at once by
+different threads
+*/
+
+#define SIEVE_SEGMENT_BYTES 32768
+// minimal number of remaining segments before the sieving is spread over several threads
+#define SIEVE_THREAD_MIN_SEGMENTS 64
+
+static const unsigned char sieve_small_primes[3] = {2, 3, 5};
+
+static const unsigned char wheel30[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+// index of the bit corresponding to residue r mod 30, 255 if r is not coprime to 30
+static const unsigned char wheel30_index[30] = {
+    255, 0, 255, 255, 255, 255, 255, 1, 255, 255, 255, 2, 255, 3, 255,
+    255, 255, 4, 255, 5, 255, 255, 255, 6, 255, 255, 255, 255, 255, 7
+};
+
+/*
+number of threads used by the multithreaded parts of the library
+0 means one thread per online processor
+*/
+int factor_threads = 0;
+
+int default_num_threads(void){
+    if (factor_threads > 0) return factor_threads;
+    long k = sysconf(_SC_NPROCESSORS_ONLN);
+    return (k > 0) ? (int) k : 1;
+}
+
+typedef struct prime_iterator {
+    unsigned long start;        // smallest prime to return
+    unsigned long stop;         // largest bound (inclusive) of the primes to return
+    unsigned long low;          // the first byte of the buffer stands for low, low + 30
+    unsigned char *buffer;      // nbuffer segments of the sieve
+    size_t nbuffer;             // number of segments allocated in buffer
+    size_t filled;              // number of valid bytes in buffer
+    size_t pos;                 // current byte in buffer
+    unsigned int bits;          // remaining bits of the current byte
+    unsigned long *base;        // primes 7 <= p <= base_bound used to sieve
+    size_t nbase;
+    unsigned long base_bound;
+    int small;                  // next index in {2, 3, 5} not returned yet
+    int nthreads;
+} prime_iterator;
+
+/*
+integer square root of n rounded down
+*/
+unsigned long sieve_isqrt(unsigned long n){
+    if (n < 2) return n;
+    // Newton iteration starting above the root
+    unsigned long r = 1UL << ((64 - __builtin_clzl(n)) / 2 + 1);
+    while (1){
+        unsigned long s = (r + n / r) / 2;
+        if (s >= r) break;
+        r = s;
+    }
+    return r;
+}
+
+/*
+make sure the base primes cover every p with p^2 <= bound
+the base primes are obtained by a simple sieve of Eratosthenes on odd numbers
+*/
+void prime_iterator_extend_base(prime_iterator *it, unsigned long bound){
+    unsigned long s = sieve_isqrt(bound) + 1;
+    if (s <= it->base_bound) return;
+    // grow geometrically to avoid recomputing the base primes too often
+    if (s < 2 * it->base_bound) s = 2 * it->base_bound;
+
+    unsigned char *odd = (unsigned char*) calloc(s / 2 + 1, 1);
+    for (unsigned long i = 3; i * i <= s; i += 2){
+        if (odd[i / 2]) continue;
+        for (unsigned long j = i * i; j <= s; j += 2 * i) odd[j / 2] = 1;
+    }
+
+    size_t count = 0;
+    for (unsigned long i = 7; i <= s; i += 2) if (!odd[i / 2]) count++;
+    it->base = (unsigned long*) realloc(it->base, (count + 1) * sizeof(unsigned long));
+    it->nbase = 0;
+    for (unsigned long i = 7; i <= s; i += 2) if (!odd[i / 2]) it->base[it->nbase++] = i;
+    it->base_bound = s;
+    free(odd);
+}
+
+/*
+sieve the integers in [low, low + 30*nbytes) into seg, low is a multiple of 30
+seg[i] bit k is set when 30*i + wheel30[k] + low is prime
+*/
+void sieve_segment(unsigned char *seg, size_t nbytes, unsigned long low, const unsigned long *base, size_t nbase){
+    memset(seg, 0xff, nbytes);
+    unsigned long high = low + 30 * nbytes;
+
+    // 1 is not a prime
+    if (low == 0) seg[0] &= 0xfe;
+
+    for (size_t i = 0; i < nbase; i++){
+        unsigned long p = base[i];
+        if (p * p >= high) break;
+        unsigned long first = (p * p > low) ? p * p : low;
+
+        // multiples p*q with q coprime to 30, for each residue class of q mod 30
+        // the multiples lie on a single bit of the bytes, at a stride of p bytes
+        for (int k = 0; k < 8; k++){
+            unsigned long w = wheel30[k];
+            unsigned long q = (first + p - 1) / p;
+            // smallest q' >= q with q' = w mod 30
+            unsigned long j = (q > w) ? (q - w + 29) / 30 : 0;
+            unsigned long m = p * (30 * j + w);
+            if (m >= high) continue;
+            unsigned char mask = (unsigned char) ~(1u << wheel30_index[m % 30]);
+            size_t b = (m - low) / 30;
+            for (; b < nbytes; b += p) seg[b] &= mask;
+        }
+    }
+}
+
+typedef struct sieve_job {
+    unsigned char *seg;
+    size_t nbytes;
+    unsigned long low;
+    const unsigned long *base;
+    size_t nbase;
+} sieve_job;
+
+void *sieve_segment_thread(void *arg){
+    sieve_job *job = (sieve_job*) arg;
+    sieve_segment(job->seg, job->nbytes, job->low, job->base, job->nbase);
+    return NULL;
+}
+
+/*
+sieve the next segments after the ones currently in the buffer
+*/
+void prime_iterator_refill(prime_iterator *it){
+    it->low += 30 * it->filled;
+
+    unsigned long remaining = (it->stop - it->low) / 30 + 1;
+    size_t nseg = 1;
+    if (it->nthreads > 1 && remaining / SIEVE_SEGMENT_BYTES >= SIEVE_THREAD_MIN_SEGMENTS) nseg = it->nbuffer;
+
+    size_t nbytes = nseg * SIEVE_SEGMENT_BYTES;
+    if (nbytes > remaining) nbytes = remaining;
+    unsigned long high = it->low + 30 * nbytes;
+    prime_iterator_extend_base(it, (high < it->stop) ? high : it->stop);
+
+    if (nseg == 1) sieve_segment(it->buffer, nbytes, it->low, it->base, it->nbase);
+    else {
+        pthread_t *tid = (pthread_t*) malloc(nseg * sizeof(pthread_t));
+        sieve_job *job = (sieve_job*) malloc(nseg * sizeof(sieve_job));
+        size_t njobs = 0;
+        for (size_t off = 0; off < nbytes; off += SIEVE_SEGMENT_BYTES){
+            job[njobs].seg = it->buffer + off;
+            job[njobs].nbytes = (nbytes - off < SIEVE_SEGMENT_BYTES) ? nbytes - off : SIEVE_SEGMENT_BYTES;
+            job[njobs].low = it->low + 30 * off;
+            job[njobs].base = it->base;
+            job[njobs].nbase = it->nbase;
+            njobs++;
+        }
+        // the calling thread sieves the first segment itself
+        for (size_t i = 1; i < njobs; i++) pthread_create(&tid[i], NULL, sieve_segment_thread, &job[i]);
+        sieve_segment_thread(&job[0]);
+        for (size_t i = 1; i < njobs; i++) pthread_join(tid[i], NULL);
+        free(tid);
+        free(job);
+    }
+
+    it->filled = nbytes;
+    it->pos = 0;
+    it->bits = it->buffer[0];
+}
+
+/*
+initialize an iterator over the primes p with start <= p <= stop
+*/
+void prime_iterator_init(prime_iterator *it, unsigned long start, unsigned long stop){
+    it->start = start;
+    it->stop = stop;
+    it->base = NULL;
+    it->nbase = 0;
+    it->base_bound = 0;
+    it->nthreads = default_num_threads();
+    it->nbuffer = (it->nthreads > 1) ? (size_t) it->nthreads : 1;
+    it->buffer = (unsigned char*) malloc(it->nbuffer * SIEVE_SEGMENT_BYTES);
+
+    it->small = 0;
+    while ((it->small < 3) && (sieve_small_primes[it->small] < start)) it->small++;
+
+    // the first sieved byte, refill moves low forward by 30*filled
+    it->low = (start / 30) * 30;
+    it->filled = 0;
+    it->pos = 0;
+    it->bits = 0;
+    if (stop >= it->low) {
+        prime_iterator_refill(it);
+        // discard the bits standing for numbers < start
+        while (it->bits && (it->low + wheel30[__builtin_ctz(it->bits)] < start)) it->bits &= it->bits - 1;
+    }
+}
+
+/*
+return the next prime of the range, 0 when the range is exhausted
+*/
+unsigned long prime_iterator_next(prime_iterator *it){
+    if (it->small < 3){
+        unsigned long p = sieve_small_primes[it->small++];
+        if (p <= it->stop) return p;
+        it->small = 3;
+        return 0;
+    }
+
+    while (it->bits == 0){
+        if (it->filled == 0) return 0;
+        it->pos++;
+        if (it->pos >= it->filled){
+            if (it->low + 30 * it->filled > it->stop) {
+                it->filled = 0;
+                return 0;
+            }
+            prime_iterator_refill(it);
+        } else it->bits = it->buffer[it->pos];
+    }
+
+    int k = __builtin_ctz(it->bits);
+    it->bits &= it->bits - 1;
+    unsigned long p = it->low + 30 * it->pos + wheel30[k];
+    if (p > it->stop){
+        it->bits = 0;
+        it->filled = 0;
+        return 0;
+    }
+    return p;
+}
+
+void prime_iterator_clear(prime_iterator *it){
+    free(it->buffer);
+    free(it->base);
+    it->buffer = NULL;
+    it->base = NULL;
+}
+
+#endif